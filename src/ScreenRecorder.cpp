@@ -70,14 +70,34 @@ int ScreenRecorder::initialize() {
 	video_width = img->get_width();
 	video_height = img->get_height();
 
+	// The output modes decide which contexts exist and how they are closed,
+	// so they are fixed from here until the recorder stops.
+	active_sequence_mode = sequence_mode;
+	active_replay_mode = replay_mode;
+	active_stream_output = stream_output;
+
+	if (active_sequence_mode) {
+		return initialize_sequence();
+	}
+
 	// Deduce Format and Codec from given filename
 	// Apparently attempting to free this will crash the program, so I'm
 	// assuming this is managed by godot.
 	char *c_file_name = file_name.alloc_c_string();
 
-	avformat_alloc_output_context2(
-		&fmtctx,
-		nullptr, nullptr, c_file_name);
+	if (active_stream_output) {
+		// There is no file to deduce the format from when streaming to memory.
+		avformat_alloc_output_context2(&fmtctx, nullptr, stream_format.alloc_c_string(), nullptr);
+
+		if (!fmtctx) {
+			PRINT_ERROR("Could not load '" + stream_format + "' format. Init failed.");
+			return FAILURE;
+		}
+	} else {
+		avformat_alloc_output_context2(
+			&fmtctx,
+			nullptr, nullptr, c_file_name);
+	}
 	
 	if (!fmtctx) {
 		PRINT_ERROR("Could not deduce output format from '" + file_name + "'. Attempting to use '" DEFAULT_OUTPUT_CODEC "'...");
@@ -114,6 +134,13 @@ int ScreenRecorder::initialize() {
 		av_dict_set(&opt, keystr.alloc_c_string(), value.alloc_c_string(), 0);
 	}
 
+	// The memory output cannot seek back to patch the moov atom, so MP4 has to
+	// be fragmented.
+	if (active_stream_output && !av_dict_get(opt, "movflags", nullptr, 0)
+			&& (!strcmp(fmt->name, "mp4") || !strcmp(fmt->name, "mov"))) {
+		av_dict_set(&opt, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+	}
+
 	// Now load the codec
 
 	codec = avcodec_find_encoder(fmt->video_codec);
@@ -188,6 +215,15 @@ int ScreenRecorder::initialize() {
 	tmp_frame = alloc_frame(AV_PIX_FMT_RGB24, video_width, video_height);
 	frame = alloc_frame(codecctx->pix_fmt, video_width, video_height);
 
+	// Sub-frames are summed in 16 bits, which holds at most 257 full-white
+	// RGB24 frames. The value is fixed from here until the recorder stops.
+	active_subframes = std::max(1, std::min(subframes, MAX_SUBFRAMES));
+	subframe_index = 0;
+
+	if (active_subframes > 1) {
+		subframe_accum.assign(size_t(video_width) * video_height * 3, 0);
+	}
+
 	// Copy stream parameters into muxer
 
 	ret = avcodec_parameters_from_context(st->codecpar, codecctx);
@@ -202,6 +238,7 @@ int ScreenRecorder::initialize() {
 	av_dump_format(fmtctx, 0, c_file_name, 1);
 
 	recorder_state = STATE_FINISHED;
+	subframes_locked = true;
 
 	return SUCCESS;
 }
@@ -226,19 +263,33 @@ int ScreenRecorder::start_recorder() {
 
 	char *c_final_file_name = final_file_name.alloc_c_string();
 
-	if (!(fmt->flags & AVFMT_NOFILE)) {
-		ret = avio_open(&fmtctx->pb, c_final_file_name, AVIO_FLAG_WRITE);
-		if (ret < 0) {
-			PRINT_ERROR("Could not open " + final_file_name + ": " + get_avcodec_error_string(ret));
+	if (active_sequence_mode) {
+		if (start_sequence() < 0) {
 			return FAILURE;
 		}
-	}
+	} else if (!active_replay_mode) {
+		// Not reached in replay mode: nothing is written there until
+		// save_replay() is called, so the output is never opened.
+		if (active_stream_output) {
+			ret = open_output_stream();
+			if (ret < 0) {
+				PRINT_ERROR("Could not open memory output: " + get_avcodec_error_string(ret));
+				return FAILURE;
+			}
+		} else if (!(fmt->flags & AVFMT_NOFILE)) {
+			ret = avio_open(&fmtctx->pb, c_final_file_name, AVIO_FLAG_WRITE);
+			if (ret < 0) {
+				PRINT_ERROR("Could not open " + final_file_name + ": " + get_avcodec_error_string(ret));
+				return FAILURE;
+			}
+		}
 
-	ret = avformat_write_header(fmtctx, &opt);
-	
-	if (ret < 0) {
-		PRINT_ERROR("Could not write header: " + get_avcodec_error_string(ret));
-		return FAILURE;
+		ret = avformat_write_header(fmtctx, &opt);
+
+		if (ret < 0) {
+			PRINT_ERROR("Could not write header: " + get_avcodec_error_string(ret));
+			return FAILURE;
+		}
 	}
 
 #ifdef MULTITHREADED
@@ -252,11 +303,21 @@ int ScreenRecorder::start_recorder() {
 	thread->start(this, "_thread_func");
 #endif
 
+	if (!trace_file.empty()) {
+		trace.start(size_t(std::max(trace_buffer_size, 1)));
+	}
+
 	recorder_state = STATE_STARTED;
+
+	if (offline_render) {
+		begin_offline_render();
+	}
+
 	return SUCCESS;
 }
 
 void ScreenRecorder::prepare_frame(AVFrame *f) {
+	TraceScope ts(trace, "readback", next_pts);
 
 #ifdef MULTITHREADED
 	access->lock();
@@ -312,15 +373,29 @@ int ScreenRecorder::get_video_frame() {
 
 	prepare_frame(tmp_frame);
 
+	if (active_subframes > 1) {
+		accumulate_subframe(tmp_frame);
+
+		if (++subframe_index < active_subframes) {
+			return 1;
+		}
+
+		resolve_subframes(tmp_frame);
+		subframe_index = 0;
+	}
+
 	// failed attempt to directly use PoolByteArray in sws_scale.
 	//tmp_frame->data[0] =  (uint8_t *) get_viewport()->get_texture()->get_data()->get_data().read().ptr();
 
-	sws_scale(swsctx,
-			(const uint8_t * const *) tmp_frame->data,
-			tmp_frame->linesize,
-			0, codecctx->height, 
-			frame->data, frame->linesize
-			);
+	{
+		TraceScope ts(trace, "convert", next_pts);
+		sws_scale(swsctx,
+				(const uint8_t * const *) tmp_frame->data,
+				tmp_frame->linesize,
+				0, codecctx->height, 
+				frame->data, frame->linesize
+				);
+	}
 
 	frame->pts = next_pts;
 	next_pts += 1;
@@ -328,6 +403,50 @@ int ScreenRecorder::get_video_frame() {
 	return 0;
 }
 
+/*
+ * Sub-frame accumulation
+ *
+ * With subframes = K, K consecutive captures are summed into a 16 bit buffer
+ * and only their average is converted and encoded, so encoding stays at the
+ * output frame rate. The loops are kept simple so that the compiler can
+ * vectorise them.
+ */
+
+void ScreenRecorder::accumulate_subframe(AVFrame *f) {
+	int row = f->width * 3;
+	uint16_t *acc = subframe_accum.data();
+
+	for (int y = 0; y < f->height; y++) {
+		const uint8_t *src = f->data[0] + y * f->linesize[0];
+		uint16_t *dst = acc + size_t(y) * row;
+
+		if (subframe_index == 0) {
+			for (int x = 0; x < row; x++)
+				dst[x] = src[x];
+		} else {
+			for (int x = 0; x < row; x++)
+				dst[x] += src[x];
+		}
+	}
+}
+
+void ScreenRecorder::resolve_subframes(AVFrame *f) {
+	int row = f->width * 3;
+	const uint16_t *acc = subframe_accum.data();
+
+	// Rounded division by K as a multiply and shift; exact for K <= 257.
+	uint32_t half = active_subframes / 2;
+	uint64_t m = ((uint64_t(1) << 32) + active_subframes - 1) / active_subframes;
+
+	for (int y = 0; y < f->height; y++) {
+		const uint16_t *src = acc + size_t(y) * row;
+		uint8_t *dst = f->data[0] + y * f->linesize[0];
+
+		for (int x = 0; x < row; x++)
+			dst[x] = uint8_t(((src[x] + half) * m) >> 32);
+	}
+}
+
 static void log_packet(const AVFormatContext *fmt_ctx, const AVPacket *pkt) {
 	AVRational *time_base = &fmt_ctx->streams[pkt->stream_index]->time_base;
 
@@ -377,12 +496,22 @@ int ScreenRecorder::write_video_frame() {
 		return -1;
 	}
 
+	// Still accumulating sub-frames, nothing to encode yet.
+	if (ret > 0) {
+		return AVERROR(EAGAIN);
+	}
+
 	if (frame) {
 		std::cout << "Send frame  " << frame->pts << std::endl;
 	}
 
-	ret = avcodec_send_frame(codecctx, frame);
-	
+	int64_t frame_pts = frame->pts;
+
+	{
+		TraceScope ts(trace, "encode_send", frame_pts);
+		ret = avcodec_send_frame(codecctx, frame);
+	}
+
 	if (ret < 0) {
 		PRINT_ERROR("Error encoding video frame: " + get_avcodec_error_string(ret));
 		return ret;
@@ -391,7 +520,10 @@ int ScreenRecorder::write_video_frame() {
 	ret = 0;
 
 	while (ret >= 0) {
-		ret = avcodec_receive_packet(codecctx, &pkt);
+		{
+			TraceScope ts(trace, "encode_receive", frame_pts);
+			ret = avcodec_receive_packet(codecctx, &pkt);
+		}
 		// packet.duration = st.time_base.den / 60;
 		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
 			return ret;
@@ -403,7 +535,14 @@ int ScreenRecorder::write_video_frame() {
 
 		std::cout << "Recv Packet " << pkt.pts << " " << pkt.size << std::endl;
 
-		ret = write_frame(fmtctx, &codecctx->time_base, st, &pkt);
+		{
+			TraceScope ts(trace, "mux_write", frame_pts);
+			if (active_replay_mode) {
+				push_replay_packet(&pkt);
+			} else {
+				ret = write_frame(fmtctx, &codecctx->time_base, st, &pkt);
+			}
+		}
 
 		received_frame_count++;
 
@@ -425,7 +564,11 @@ int ScreenRecorder::recorder_step() {
 		return int(godot::Error::ERR_UNAVAILABLE);
 	}
 
-	ret = write_video_frame();
+	if (active_sequence_mode) {
+		ret = write_sequence_frame();
+	} else {
+		ret = write_video_frame();
+	}
 
 	if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
 		PRINT_ERROR("Stream Error Detected. Exiting.");
@@ -461,6 +604,770 @@ void ScreenRecorder::push_frame() {
 
 #endif
 
+/*
+ * Instant replay
+ *
+ * Encoded packets are kept in replay_ring in codec time base. Eviction always
+ * drops everything up to the next keyframe so that the ring starts on a
+ * keyframe and can be remuxed as-is without re-encoding.
+ */
+
+void ScreenRecorder::push_replay_packet(AVPacket *pkt) {
+	AVPacket *p = av_packet_alloc();
+
+	if (!p) {
+		PRINT_ERROR("Could not allocate replay packet.");
+		return;
+	}
+
+	av_packet_move_ref(p, pkt);
+
+	replay_access->lock();
+
+	// A ring that does not start on a keyframe is useless for remuxing.
+	if (!replay_ring.empty() || (p->flags & AV_PKT_FLAG_KEY)) {
+		replay_ring.push_back(p);
+		replay_ring_bytes += p->size;
+
+		// Packets arrive in decode order, so with B-frames the newest packet
+		// is not necessarily the latest in presentation order.
+		if (p->pts != AV_NOPTS_VALUE && (replay_max_pts == AV_NOPTS_VALUE || p->pts > replay_max_pts)) {
+			replay_max_pts = p->pts;
+		}
+
+		evict_replay_packets();
+	} else {
+		av_packet_free(&p);
+	}
+
+	replay_access->unlock();
+}
+
+// Must be called with replay_access held.
+void ScreenRecorder::evict_replay_packets() {
+	int64_t window = int64_t(replay_duration / av_q2d(codecctx->time_base));
+
+	while (replay_ring.size() > 1) {
+		// Find the start of the next GOP.
+		size_t next_key = 1;
+		int64_t gop_bytes = replay_ring[0]->size;
+
+		while (next_key < replay_ring.size() && !(replay_ring[next_key]->flags & AV_PKT_FLAG_KEY)) {
+			gop_bytes += replay_ring[next_key]->size;
+			next_key++;
+		}
+
+		if (next_key == replay_ring.size()) {
+			// Only one GOP left, it has to stay.
+			return;
+		}
+
+		// Only drop the oldest GOP when the remainder still covers the
+		// requested window, or when we are over the byte budget.
+		bool over_bytes = replay_max_bytes > 0 && replay_ring_bytes > replay_max_bytes;
+		bool over_window = replay_max_pts - replay_ring[next_key]->pts >= window;
+
+		if (!over_bytes && !over_window) {
+			return;
+		}
+
+		for (size_t i = 0; i < next_key; i++) {
+			av_packet_free(&replay_ring.front());
+			replay_ring.pop_front();
+		}
+
+		replay_ring_bytes -= gop_bytes;
+	}
+}
+
+void ScreenRecorder::clear_replay_ring() {
+	replay_access->lock();
+
+	for (AVPacket *p : replay_ring) {
+		av_packet_free(&p);
+	}
+
+	replay_ring.clear();
+	replay_ring_bytes = 0;
+	replay_max_pts = AV_NOPTS_VALUE;
+
+	replay_access->unlock();
+}
+
+void ScreenRecorder::wait_for_replay() {
+	if (replay_thread.is_valid()) {
+		replay_thread->wait_to_finish();
+		replay_thread.unref();
+	}
+}
+
+static int remux_packets(const char *path, const AVCodecParameters *par, AVRational time_base, AVDictionary **opt, std::vector<AVPacket *> &pkts) {
+	AVFormatContext *octx = nullptr;
+	AVStream *ost;
+	int64_t offset;
+	int ret;
+
+	avformat_alloc_output_context2(&octx, nullptr, nullptr, path);
+
+	if (!octx) {
+		return AVERROR_MUXER_NOT_FOUND;
+	}
+
+	ost = avformat_new_stream(octx, nullptr);
+
+	if (!ost) {
+		avformat_free_context(octx);
+		return AVERROR(ENOMEM);
+	}
+
+	ret = avcodec_parameters_copy(ost->codecpar, par);
+	ost->codecpar->codec_tag = 0;
+	ost->time_base = time_base;
+
+	if (ret >= 0 && !(octx->oformat->flags & AVFMT_NOFILE)) {
+		ret = avio_open(&octx->pb, path, AVIO_FLAG_WRITE);
+	}
+
+	if (ret >= 0) {
+		ret = avformat_write_header(octx, opt);
+	}
+
+	// Shift timestamps so that the replay starts at zero.
+	offset = pkts.front()->dts != AV_NOPTS_VALUE ? pkts.front()->dts : pkts.front()->pts;
+
+	for (size_t i = 0; ret >= 0 && i < pkts.size(); i++) {
+		AVPacket *p = pkts[i];
+
+		if (p->pts != AV_NOPTS_VALUE)
+			p->pts -= offset;
+		if (p->dts != AV_NOPTS_VALUE)
+			p->dts -= offset;
+
+		av_packet_rescale_ts(p, time_base, ost->time_base);
+		p->stream_index = ost->index;
+
+		ret = av_interleaved_write_frame(octx, p);
+	}
+
+	if (ret >= 0) {
+		ret = av_write_trailer(octx);
+	}
+
+	if (!(octx->oformat->flags & AVFMT_NOFILE)) {
+		avio_closep(&octx->pb);
+	}
+
+	avformat_free_context(octx);
+
+	return ret;
+}
+
+int ScreenRecorder::save_replay(godot::String path) {
+	if (!active_replay_mode || recorder_state != STATE_STARTED) {
+		PRINT_ERROR("save_replay called when the recorder is not recording in replay mode.");
+		return int(godot::Error::ERR_UNAVAILABLE);
+	}
+
+	if (replay_saving) {
+		PRINT_ERROR("save_replay called while another replay is being saved.");
+		return int(godot::Error::ERR_BUSY);
+	}
+
+	// Check the target container now, rather than writing an unplayable file
+	// on the saving thread.
+	godot::CharString c_path = path.utf8();
+	AVOutputFormat *replay_fmt = av_guess_format(nullptr, c_path.get_data(), nullptr);
+
+	if (!replay_fmt) {
+		PRINT_ERROR("Could not deduce replay format from '" + path + "'.");
+		return int(godot::Error::ERR_INVALID_PARAMETER);
+	}
+
+	wait_for_replay();
+
+	// Packets are reference counted, so taking a snapshot does not copy any
+	// encoded data. The encoder can keep filling the ring while we save.
+	replay_access->lock();
+
+	for (AVPacket *p : replay_ring) {
+		AVPacket *c = av_packet_clone(p);
+		if (c) {
+			replay_snapshot.push_back(c);
+		}
+	}
+
+	replay_access->unlock();
+
+	if (replay_snapshot.empty()) {
+		PRINT_ERROR("Replay buffer is empty.");
+		return int(godot::Error::ERR_UNAVAILABLE);
+	}
+
+	if (!replay_par) {
+		replay_par = avcodec_parameters_alloc();
+	}
+
+	avcodec_parameters_from_context(replay_par, codecctx);
+
+	if ((replay_fmt->flags & AVFMT_GLOBALHEADER) && replay_par->extradata_size == 0) {
+		PRINT_ERROR("'" + path + "' needs global headers, which the container of '" + file_name + "' did not ask the encoder for.");
+		for (AVPacket *p : replay_snapshot) {
+			av_packet_free(&p);
+		}
+		replay_snapshot.clear();
+		return int(godot::Error::ERR_INVALID_PARAMETER);
+	}
+
+	replay_time_base = codecctx->time_base;
+	replay_file_name = path;
+
+	// Muxer options from the options dictionary apply to replays too.
+	av_dict_free(&replay_opt);
+	av_dict_copy(&replay_opt, opt, 0);
+
+	replay_saving = true;
+	replay_thread = godot::Ref<godot::Thread>(godot::Thread::_new());
+	replay_thread->start(this, "_replay_thread_func");
+
+	return SUCCESS;
+}
+
+bool ScreenRecorder::is_saving_replay() {
+	return replay_saving;
+}
+
+void ScreenRecorder::_replay_thread_func(godot::Variant v) {
+	godot::CharString c_path = replay_file_name.utf8();
+	int ret = remux_packets(c_path.get_data(), replay_par, replay_time_base, &replay_opt, replay_snapshot);
+
+	if (ret < 0) {
+		PRINT_ERROR("Could not save replay to " + replay_file_name + ": " + get_avcodec_error_string(ret));
+	}
+
+	for (AVPacket *p : replay_snapshot) {
+		av_packet_free(&p);
+	}
+
+	replay_snapshot.clear();
+	av_dict_free(&replay_opt);
+	replay_saving = false;
+
+	call_deferred("emit_signal", "replay_saved", replay_file_name, ret < 0 ? FAILURE : SUCCESS);
+}
+
+/*
+ * Offline rendering
+ *
+ * Instead of being paced by the display, the engine is allowed to run as fast
+ * as the capture and encoding can go. Godot 3 has no API to force the process
+ * delta, so the fixed step still has to come from --fixed-fps. The engine
+ * consumes that option before get_cmdline_args(), so we check the delta we
+ * are given instead.
+ */
+
+void ScreenRecorder::begin_offline_render() {
+	godot::OS *os = godot::OS::get_singleton();
+	godot::Engine *engine = godot::Engine::get_singleton();
+
+	saved_vsync = os->is_vsync_enabled();
+	saved_target_fps = engine->get_target_fps();
+	saved_iterations_per_second = engine->get_iterations_per_second();
+	saved_physics_jitter_fix = engine->get_physics_jitter_fix();
+
+	os->set_use_vsync(false);
+	engine->set_target_fps(0);
+	engine->set_iterations_per_second(frame_rate * active_subframes);
+	engine->set_physics_jitter_fix(0);
+
+	offline_frames = 0;
+	offline_delta_warned = false;
+	offline_active = true;
+	set_process(true);
+}
+
+// Called from stop_recorder(), so that stopping early also gives the engine
+// its settings back.
+void ScreenRecorder::end_offline_render() {
+	godot::OS *os = godot::OS::get_singleton();
+	godot::Engine *engine = godot::Engine::get_singleton();
+
+	offline_active = false;
+	set_process(false);
+
+	os->set_use_vsync(saved_vsync);
+	engine->set_target_fps(saved_target_fps);
+	engine->set_iterations_per_second(saved_iterations_per_second);
+	engine->set_physics_jitter_fix(saved_physics_jitter_fix);
+}
+
+void ScreenRecorder::finish_offline_render() {
+	stop_recorder();
+
+	// offline_frames counts captures; report encoded frames.
+	emit_signal("render_finished", offline_frames / active_subframes);
+
+	if (quit_on_finish) {
+		get_tree()->quit();
+	}
+}
+
+void ScreenRecorder::_process(float delta) {
+	if (!offline_render || recorder_state != STATE_STARTED) {
+		return;
+	}
+
+	int64_t target = render_frame_count;
+
+	if (target <= 0) {
+		target = int64_t(render_duration * frame_rate);
+	}
+
+	// Every output frame takes subframes captures.
+	target *= active_subframes;
+
+	// The first delta still covers the frame in which recording started.
+	double expected = 1.0 / (frame_rate * active_subframes);
+
+	if (offline_frames > 0 && !offline_delta_warned && std::abs(delta - expected) > expected * 0.01) {
+		PRINT_ERROR("Offline render is not running at a fixed step of " + godot::String::num_int64(frame_rate * active_subframes) + " fps. Start Godot with --fixed-fps.");
+		offline_delta_warned = true;
+	}
+
+#ifdef MULTITHREADED
+	push_frame();
+#else
+	if (recorder_step() != SUCCESS) {
+		finish_offline_render();
+		return;
+	}
+#endif
+
+	offline_frames++;
+
+	if (offline_frames >= target) {
+		finish_offline_render();
+	}
+}
+
+/*
+ * Image sequences
+ *
+ * Frames have no dependency on each other, so each one is handed to a pool of
+ * workers with their own encoder context. The manifest is written in frame
+ * order as soon as all earlier frames are done.
+ */
+
+static AVCodecContext *open_image_encoder(AVCodec *c, int width, int height, int frame_rate, int compression) {
+	AVCodecContext *ctx = avcodec_alloc_context3(c);
+
+	if (!ctx)
+		return nullptr;
+
+	ctx->width = width;
+	ctx->height = height;
+	ctx->pix_fmt = AV_PIX_FMT_RGB24;
+	ctx->time_base = (AVRational) { 1, frame_rate };
+	// Parallelism comes from the pool, not from the encoder.
+	ctx->thread_count = 1;
+
+	if (compression >= 0)
+		ctx->compression_level = compression;
+
+	if (avcodec_open2(ctx, c, nullptr) < 0) {
+		avcodec_free_context(&ctx);
+		return nullptr;
+	}
+
+	return ctx;
+}
+
+static int write_encoded_image(AVCodecContext *ctx, AVPacket *pkt, AVFrame *f, const char *path) {
+	AVIOContext *pb = nullptr;
+	int ret;
+
+	ret = avcodec_send_frame(ctx, f);
+
+	if (ret >= 0)
+		ret = avcodec_receive_packet(ctx, pkt);
+
+	if (ret >= 0)
+		ret = avio_open(&pb, path, AVIO_FLAG_WRITE);
+
+	if (ret >= 0) {
+		avio_write(pb, pkt->data, pkt->size);
+		ret = avio_closep(&pb);
+	}
+
+	av_packet_unref(pkt);
+	return ret;
+}
+
+static const float *get_srgb_to_linear_table() {
+	static float table[256];
+	static bool ready = [] {
+		for (int i = 0; i < 256; i++) {
+			float c = i / 255.0f;
+			table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return true;
+	}();
+
+	(void) ready;
+	return table;
+}
+
+// FFmpeg has no EXR encoder, so EXR goes through godot::Image. Note that this
+// is only available in builds that include tinyexr (e.g. the editor). Each
+// sRGB byte is mapped straight to a linear float; Image::srgb_to_linear()
+// would linearise while still at 8 bits and crush the shadows.
+static int write_exr_image(AVFrame *f, const char *path) {
+	int row = f->width * 3;
+	const float *lut = get_srgb_to_linear_table();
+	godot::PoolByteArray data;
+
+	data.resize(row * f->height * sizeof(float));
+
+	{
+		godot::PoolByteArray::Write w = data.write();
+		float *dst = (float *) w.ptr();
+
+		for (int y = 0; y < f->height; y++) {
+			const uint8_t *src = f->data[0] + y * f->linesize[0];
+			for (int x = 0; x < row; x++) {
+				dst[size_t(y) * row + x] = lut[src[x]];
+			}
+		}
+	}
+
+	godot::Ref<godot::Image> img = godot::Image::_new();
+	img->create_from_data(f->width, f->height, false, godot::Image::Format::FORMAT_RGBF, data);
+
+	return img->save_exr(godot::String(path), false) == godot::Error::OK ? 0 : AVERROR(EIO);
+}
+
+int ScreenRecorder::initialize_sequence() {
+	godot::String ext = file_name.get_extension().to_lower();
+	godot::String pattern = file_name;
+
+	if (file_name.find("%") < 0) {
+		pattern = file_name.get_basename() + "_%0" + godot::String::num_int64(sequence_padding) + "d." + ext;
+	}
+
+	sequence_pattern = pattern.utf8().get_data();
+	sequence_manifest_name = pattern.get_base_dir().plus_file("manifest.txt");
+
+	char buf[1024];
+	if (av_get_frame_filename2(buf, sizeof(buf), sequence_pattern.c_str(), 0, 0) < 0) {
+		PRINT_ERROR("'" + pattern + "' is not a valid frame number pattern. Init failed.");
+		return FAILURE;
+	}
+
+	if (ext == "png") {
+		sequence_codec = avcodec_find_encoder_by_name(ext.utf8().get_data());
+
+		if (!sequence_codec) {
+			PRINT_ERROR("Could not find encoder for '" + ext + "'. Init failed.");
+			return FAILURE;
+		}
+	} else if (ext == "exr") {
+		sequence_codec = nullptr;
+
+		if (sequence_compression >= 0) {
+			PRINT_ERROR("sequence_compression is not supported for EXR and will be ignored.");
+		}
+	} else {
+		PRINT_ERROR("Unsupported image sequence format '" + ext + "'. Init failed.");
+		return FAILURE;
+	}
+
+	if (subframes > 1) {
+		PRINT_ERROR("subframes is not supported for image sequences and will be ignored.");
+	}
+
+	active_subframes = 1;
+
+	sequence_worker_count = sequence_threads;
+
+	if (sequence_worker_count <= 0) {
+		sequence_worker_count = godot::OS::get_singleton()->get_processor_count();
+	}
+
+	std::cout << "ScreenRecorder Init (image sequence)" << std::endl
+			  << "====================================" << std::endl
+			  << "pattern: " << sequence_pattern << std::endl
+			  << "video_width: " << video_width << std::endl
+			  << "video_height: " << video_height << std::endl
+			  << "threads: " << sequence_worker_count << std::endl
+			  << "compression: " << sequence_compression << std::endl;
+
+	recorder_state = STATE_FINISHED;
+	subframes_locked = true;
+
+	return SUCCESS;
+}
+
+int ScreenRecorder::start_sequence() {
+	int ret = avio_open(&sequence_manifest, sequence_manifest_name.utf8().get_data(), AVIO_FLAG_WRITE);
+
+	if (ret < 0) {
+		PRINT_ERROR("Could not open " + sequence_manifest_name + ": " + get_avcodec_error_string(ret));
+		return ret;
+	}
+
+	sequence_done.clear();
+	sequence_next_manifest = 0;
+	sequence_errors = 0;
+
+	// Two frames in flight per worker keeps everyone busy while bounding the
+	// memory held by raw frames.
+	for (int i = 0; i < sequence_worker_count * 2; i++) {
+		sequence_free_sem->post();
+	}
+
+	for (int i = 0; i < sequence_worker_count; i++) {
+		godot::Ref<godot::Thread> t = godot::Thread::_new();
+		t->start(this, "_sequence_worker_func", i);
+		sequence_workers.push_back(t);
+	}
+
+	return SUCCESS;
+}
+
+int ScreenRecorder::write_sequence_frame() {
+	sequence_free_sem->wait();
+
+	AVFrame *f = alloc_frame(AV_PIX_FMT_RGB24, video_width, video_height);
+
+	if (!f) {
+		sequence_free_sem->post();
+		return AVERROR(ENOMEM);
+	}
+
+	prepare_frame(f);
+	f->pts = next_pts;
+
+	sequence_access->lock();
+	sequence_jobs.push({ next_pts, f });
+	sequence_access->unlock();
+	sequence_job_sem->post();
+
+	next_pts += 1;
+	received_frame_count++;
+
+	return sequence_errors > 0 ? AVERROR(EIO) : AVERROR(EAGAIN);
+}
+
+void ScreenRecorder::finish_sequence_frame(int64_t index, const std::string &name) {
+	sequence_access->lock();
+
+	sequence_done[index] = name;
+
+	while (!sequence_done.empty() && sequence_done.begin()->first == sequence_next_manifest) {
+		if (!sequence_done.begin()->second.empty()) {
+			avio_printf(sequence_manifest, "%s\n", sequence_done.begin()->second.c_str());
+		}
+		sequence_done.erase(sequence_done.begin());
+		sequence_next_manifest++;
+	}
+
+	avio_flush(sequence_manifest);
+
+	sequence_access->unlock();
+}
+
+void ScreenRecorder::_sequence_worker_func(godot::Variant v) {
+	AVCodecContext *ctx = nullptr;
+	AVPacket *pkt = av_packet_alloc();
+
+	if (sequence_codec) {
+		ctx = open_image_encoder(sequence_codec, video_width, video_height, frame_rate, sequence_compression);
+		if (!ctx) {
+			PRINT_ERROR("Could not start image encoder.");
+		}
+	}
+
+	while (true) {
+		sequence_job_sem->wait();
+
+		sequence_access->lock();
+		SequenceJob job = sequence_jobs.front();
+		sequence_jobs.pop();
+		sequence_access->unlock();
+
+		if (!job.frame) {
+			break;
+		}
+
+		char path[1024];
+		int ret = av_get_frame_filename2(path, sizeof(path), sequence_pattern.c_str(), job.index, 0);
+
+		if (ret >= 0) {
+			TraceScope ts(trace, "compress", job.index);
+
+			if (sequence_codec) {
+				ret = ctx ? write_encoded_image(ctx, pkt, job.frame, path) : AVERROR(EINVAL);
+			} else {
+				ret = write_exr_image(job.frame, path);
+			}
+		}
+
+		av_frame_free(&job.frame);
+		sequence_free_sem->post();
+
+		if (ret < 0) {
+			PRINT_ERROR("Could not write frame " + godot::String::num_int64(job.index) + ": " + get_avcodec_error_string(ret));
+			sequence_errors++;
+			finish_sequence_frame(job.index, "");
+		} else {
+			finish_sequence_frame(job.index, path);
+		}
+	}
+
+	avcodec_free_context(&ctx);
+	av_packet_free(&pkt);
+}
+
+void ScreenRecorder::stop_sequence() {
+	for (size_t i = 0; i < sequence_workers.size(); i++) {
+		sequence_access->lock();
+		sequence_jobs.push({ -1, nullptr });
+		sequence_access->unlock();
+		sequence_job_sem->post();
+	}
+
+	for (size_t i = 0; i < sequence_workers.size(); i++) {
+		sequence_workers[i]->wait_to_finish();
+	}
+
+	sequence_workers.clear();
+	avio_closep(&sequence_manifest);
+
+	// Drain the slots so that a later start_sequence begins from zero.
+	for (int i = 0; i < sequence_worker_count * 2; i++) {
+		sequence_free_sem->wait();
+	}
+
+	if (sequence_errors > 0) {
+		PRINT_ERROR(godot::String::num_int64(sequence_errors) + " frames could not be written.");
+	}
+}
+
+/*
+ * Memory output
+ *
+ * The muxer writes through a custom AVIOContext whose callback appends to a
+ * bounded queue of chunks, which GDScript drains with read_output_chunk().
+ */
+
+int ScreenRecorder::write_output_packet(void *opaque, uint8_t *buf, int buf_size) {
+	ScreenRecorder *r = (ScreenRecorder *) opaque;
+
+	r->output_access->lock();
+
+	// Nobody is reading fast enough. Drop the oldest data rather than grow
+	// without bound. Only MPEG-TS can resync after this; other containers are
+	// corrupt from here on. get_output_dropped_bytes() tells the caller.
+	while (!r->output_chunks.empty() && r->output_bytes + buf_size > r->stream_buffer_size) {
+		if (r->output_dropped == 0) {
+			PRINT_ERROR("Memory output buffer is full, dropping data. Call read_output_chunk() more often.");
+		}
+
+		r->output_bytes -= r->output_chunks.front().size();
+		r->output_dropped += r->output_chunks.front().size();
+		r->output_chunks.pop_front();
+	}
+
+	r->output_chunks.emplace_back(buf, buf + buf_size);
+	r->output_bytes += buf_size;
+
+	r->output_access->unlock();
+
+	return buf_size;
+}
+
+int ScreenRecorder::open_output_stream() {
+	uint8_t *buf = (uint8_t *) av_malloc(STREAM_IO_BUFFER_SIZE);
+
+	if (!buf) {
+		return AVERROR(ENOMEM);
+	}
+
+	fmtctx->pb = avio_alloc_context(buf, STREAM_IO_BUFFER_SIZE, 1, this, nullptr, &ScreenRecorder::write_output_packet, nullptr);
+
+	if (!fmtctx->pb) {
+		av_free(buf);
+		return AVERROR(ENOMEM);
+	}
+
+	// Hand every packet over as soon as it is muxed.
+	fmtctx->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+
+	output_access->lock();
+	output_chunks.clear();
+	output_bytes = 0;
+	output_dropped = 0;
+	output_access->unlock();
+
+	return 0;
+}
+
+void ScreenRecorder::close_output_stream() {
+	if (!fmtctx->pb) {
+		return;
+	}
+
+	avio_flush(fmtctx->pb);
+	av_freep(&fmtctx->pb->buffer);
+	avio_context_free(&fmtctx->pb);
+}
+
+godot::PoolByteArray ScreenRecorder::read_output_chunk() {
+	godot::PoolByteArray out;
+
+	output_access->lock();
+
+	out.resize(output_bytes);
+
+	{
+		godot::PoolByteArray::Write w = out.write();
+		size_t offset = 0;
+
+		for (const std::vector<uint8_t> &c : output_chunks) {
+			memcpy(w.ptr() + offset, c.data(), c.size());
+			offset += c.size();
+		}
+	}
+
+	output_chunks.clear();
+	output_bytes = 0;
+
+	output_access->unlock();
+
+	return out;
+}
+
+int64_t ScreenRecorder::get_output_dropped_bytes() {
+	output_access->lock();
+	int64_t dropped = output_dropped;
+	output_access->unlock();
+
+	return dropped;
+}
+
+void ScreenRecorder::finish_trace() {
+	if (!trace.is_enabled()) {
+		return;
+	}
+
+	trace.stop();
+
+	godot::CharString c_trace_file = trace_file.utf8();
+
+	if (trace.write_json(c_trace_file.get_data()) < 0) {
+		PRINT_ERROR("Could not write trace to " + trace_file);
+	}
+}
+
 int ScreenRecorder::stop_recorder() {
 	int ret;
 
@@ -470,6 +1377,11 @@ int ScreenRecorder::stop_recorder() {
 	}
 
 	recorder_state = STATE_FINISHED;
+	subframes_locked = false;
+
+	if (offline_active) {
+		end_offline_render();
+	}
 
 #ifdef MULTITHREADED
 
@@ -478,11 +1390,25 @@ int ScreenRecorder::stop_recorder() {
 
 #endif
 
-	PRINT_MESSAGE("Writing Trailer.");
-	ret = av_write_trailer(fmtctx);
-	if (ret < 0) {
-		PRINT_ERROR("Failed to write Trailer");
-		return FAILURE;
+	if (active_sequence_mode) {
+		stop_sequence();
+		finish_trace();
+		PRINT_MESSAGE("Finished.");
+		return SUCCESS;
+	}
+
+	if (active_replay_mode) {
+		wait_for_replay();
+		clear_replay_ring();
+		avcodec_parameters_free(&replay_par);
+	} else {
+		PRINT_MESSAGE("Writing Trailer.");
+		ret = av_write_trailer(fmtctx);
+		if (ret < 0) {
+			PRINT_ERROR("Failed to write Trailer");
+			finish_trace();
+			return FAILURE;
+		}
 	}
 
 	PRINT_MESSAGE("Cleaning Up...");
@@ -491,16 +1417,28 @@ int ScreenRecorder::stop_recorder() {
 	av_frame_free(&tmp_frame);
 	sws_freeContext(swsctx);
 
-	if (!(fmt->flags & AVFMT_NOFILE)) {
+	if (!active_replay_mode && active_stream_output) {
+		close_output_stream();
+	} else if (!active_replay_mode && !(fmt->flags & AVFMT_NOFILE)) {
 		avio_closep(&fmtctx->pb);
 	}
 
 	avformat_free_context(fmtctx);
+	finish_trace();
 	PRINT_MESSAGE("Finished.");
 
 	return SUCCESS;
 }
 
+void ScreenRecorder::set_subframes(int v) {
+	if (subframes_locked) {
+		PRINT_ERROR("subframes cannot be changed between initialize and stop_recorder.");
+		return;
+	}
+
+	subframes = v;
+}
+
 bool ScreenRecorder::is_started() {
 	return recorder_state == STATE_STARTED;
 }
@@ -516,6 +1454,13 @@ void ScreenRecorder::_register_methods() {
 	godot::register_method("recorder_step", &ScreenRecorder::recorder_step);
 	godot::register_method("is_started", &ScreenRecorder::is_started);
 	godot::register_method("get_received_frame_count", &ScreenRecorder::get_received_frame_count);
+	godot::register_method("save_replay", &ScreenRecorder::save_replay);
+	godot::register_method("read_output_chunk", &ScreenRecorder::read_output_chunk);
+	godot::register_method("get_output_dropped_bytes", &ScreenRecorder::get_output_dropped_bytes);
+	godot::register_method("is_saving_replay", &ScreenRecorder::is_saving_replay);
+	godot::register_method("_replay_thread_func", &ScreenRecorder::_replay_thread_func);
+	godot::register_method("_process", &ScreenRecorder::_process);
+	godot::register_method("_sequence_worker_func", &ScreenRecorder::_sequence_worker_func);
 #ifdef MULTITHREADED
 	godot::register_method("push_frame", &ScreenRecorder::push_frame);
 	godot::register_method("_thread_func", &ScreenRecorder::_thread_func);
@@ -560,11 +1505,129 @@ void ScreenRecorder::_register_methods() {
 		&ScreenRecorder::set_append_timestamp,
 		&ScreenRecorder::get_append_timestamp,
 		true);
+
+	godot::register_property<ScreenRecorder, bool>(
+		"replay_mode",
+		&ScreenRecorder::set_replay_mode,
+		&ScreenRecorder::get_replay_mode,
+		false);
+
+	godot::register_property<ScreenRecorder, float>(
+		"replay_duration",
+		&ScreenRecorder::set_replay_duration,
+		&ScreenRecorder::get_replay_duration,
+		30.0);
+
+	godot::register_property<ScreenRecorder, int>(
+		"replay_max_bytes",
+		&ScreenRecorder::set_replay_max_bytes,
+		&ScreenRecorder::get_replay_max_bytes,
+		0);
+
+	godot::register_property<ScreenRecorder, bool>(
+		"offline_render",
+		&ScreenRecorder::set_offline_render,
+		&ScreenRecorder::get_offline_render,
+		false);
+
+	godot::register_property<ScreenRecorder, int>(
+		"render_frame_count",
+		&ScreenRecorder::set_render_frame_count,
+		&ScreenRecorder::get_render_frame_count,
+		0);
+
+	godot::register_property<ScreenRecorder, float>(
+		"render_duration",
+		&ScreenRecorder::set_render_duration,
+		&ScreenRecorder::get_render_duration,
+		10.0);
+
+	godot::register_property<ScreenRecorder, bool>(
+		"quit_on_finish",
+		&ScreenRecorder::set_quit_on_finish,
+		&ScreenRecorder::get_quit_on_finish,
+		true);
+
+	godot::register_property<ScreenRecorder, bool>(
+		"sequence_mode",
+		&ScreenRecorder::set_sequence_mode,
+		&ScreenRecorder::get_sequence_mode,
+		false);
+
+	godot::register_property<ScreenRecorder, int>(
+		"sequence_threads",
+		&ScreenRecorder::set_sequence_threads,
+		&ScreenRecorder::get_sequence_threads,
+		0);
+
+	godot::register_property<ScreenRecorder, int>(
+		"sequence_compression",
+		&ScreenRecorder::set_sequence_compression,
+		&ScreenRecorder::get_sequence_compression,
+		-1);
+
+	godot::register_property<ScreenRecorder, int>(
+		"sequence_padding",
+		&ScreenRecorder::set_sequence_padding,
+		&ScreenRecorder::get_sequence_padding,
+		5);
+
+	godot::register_property<ScreenRecorder, godot::String>(
+		"trace_file",
+		&ScreenRecorder::set_trace_file,
+		&ScreenRecorder::get_trace_file,
+		"",
+		GODOT_METHOD_RPC_MODE_DISABLED,
+		GODOT_PROPERTY_USAGE_DEFAULT,
+		GODOT_PROPERTY_HINT_GLOBAL_FILE);
+
+	godot::register_property<ScreenRecorder, int>(
+		"trace_buffer_size",
+		&ScreenRecorder::set_trace_buffer_size,
+		&ScreenRecorder::get_trace_buffer_size,
+		65536);
+
+	godot::register_property<ScreenRecorder, int>(
+		"subframes",
+		&ScreenRecorder::set_subframes,
+		&ScreenRecorder::get_subframes,
+		1);
+
+	godot::register_property<ScreenRecorder, bool>(
+		"stream_output",
+		&ScreenRecorder::set_stream_output,
+		&ScreenRecorder::get_stream_output,
+		false);
+
+	godot::register_property<ScreenRecorder, godot::String>(
+		"stream_format",
+		&ScreenRecorder::set_stream_format,
+		&ScreenRecorder::get_stream_format,
+		"mpegts");
+
+	godot::register_property<ScreenRecorder, int>(
+		"stream_buffer_size",
+		&ScreenRecorder::set_stream_buffer_size,
+		&ScreenRecorder::get_stream_buffer_size,
+		8 * 1024 * 1024);
+
+	godot::register_signal<ScreenRecorder>("render_finished",
+		"frame_count", GODOT_VARIANT_TYPE_INT);
+
+	godot::register_signal<ScreenRecorder>("replay_saved",
+		"path", GODOT_VARIANT_TYPE_STRING,
+		"error", GODOT_VARIANT_TYPE_INT);
 }
 
 void ScreenRecorder::_init() {
 	set_process(false);
 
+	replay_access = godot::Mutex::_new();
+	sequence_access = godot::Mutex::_new();
+	output_access = godot::Mutex::_new();
+	sequence_free_sem = godot::Semaphore::_new();
+	sequence_job_sem = godot::Semaphore::_new();
+
 #ifdef MULTITHREADED
 	full_sem = godot::Semaphore::_new();
 	empty_sem = godot::Semaphore::_new();
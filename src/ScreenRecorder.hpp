@@ -36,6 +36,8 @@
 #include <ViewportTexture.hpp>
 #include <Image.hpp>
 #include <OS.hpp>
+#include <Engine.hpp>
+#include <SceneTree.hpp>
 #include <Thread.hpp>
 #include <Mutex.hpp>
 #include <Semaphore.hpp>
@@ -44,7 +46,14 @@
 #include <Object.hpp>
 
 #include <queue>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <atomic>
 #include <cstring>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 extern "C" {
@@ -68,6 +77,8 @@ extern "C" {
 
 }
 
+#include "Trace.hpp"
+
 /*
  * Multithreading is currently non-operational in this, and does not result in
  * any noticeable increase in speed.
@@ -78,6 +89,8 @@ extern "C" {
 #define DEFAULT_OUTPUT_PIX_FMT AV_PIX_FMT_YUV420P
 #define DEFAULT_SCALE_FLAGS SWS_BICUBIC
 #define DEFAULT_OUTPUT_CODEC "mpeg"
+#define MAX_SUBFRAMES 257
+#define STREAM_IO_BUFFER_SIZE 65536
 
 #define FAILURE (int(godot::Error::FAILED))
 #define SUCCESS (int(godot::Error::OK))
@@ -133,6 +146,104 @@ class ScreenRecorder : public godot::Node {
 	bool get_append_timestamp() { return append_timestamp; };
 	void set_append_timestamp(bool v) { append_timestamp = v; };
 
+	// Instant replay: keep encoded packets in memory instead of writing them
+	// to file_name, and dump the current window with save_replay().
+	bool replay_mode = false; // export
+	bool get_replay_mode() { return replay_mode; };
+	void set_replay_mode(bool v) { replay_mode = v; };
+
+	float replay_duration = 30.0; // export. Seconds kept in the ring.
+	float get_replay_duration() { return replay_duration; };
+	void set_replay_duration(float v) { replay_duration = v; };
+
+	int replay_max_bytes = 0; // export. 0 means no byte limit.
+	int get_replay_max_bytes() { return replay_max_bytes; };
+	void set_replay_max_bytes(int v) { replay_max_bytes = v; };
+
+	// Copies of the output mode flags taken at initialize().
+	bool active_replay_mode = false;
+	bool active_sequence_mode = false;
+	bool active_stream_output = false;
+
+	// Offline rendering: the recorder drives itself from _process with vsync
+	// and the frame limiter disabled, and stops after a set amount of frames.
+	bool offline_render = false; // export
+	bool get_offline_render() { return offline_render; };
+	void set_offline_render(bool v) { offline_render = v; };
+
+	int render_frame_count = 0; // export. 0 means use render_duration.
+	int get_render_frame_count() { return render_frame_count; };
+	void set_render_frame_count(int v) { render_frame_count = v; };
+
+	float render_duration = 10.0; // export. Seconds of output video.
+	float get_render_duration() { return render_duration; };
+	void set_render_duration(float v) { render_duration = v; };
+
+	bool quit_on_finish = true; // export
+	bool get_quit_on_finish() { return quit_on_finish; };
+	void set_quit_on_finish(bool v) { quit_on_finish = v; };
+
+	// Image sequence output: file_name is used as a frame number pattern
+	// (e.g. "shot_%05d.png") and every frame is compressed independently by a
+	// pool of worker threads. Supported extensions are png and exr.
+	bool sequence_mode = false; // export
+	bool get_sequence_mode() { return sequence_mode; };
+	void set_sequence_mode(bool v) { sequence_mode = v; };
+
+	int sequence_threads = 0; // export. 0 means one per processor.
+	int get_sequence_threads() { return sequence_threads; };
+	void set_sequence_threads(int v) { sequence_threads = v; };
+
+	int sequence_compression = -1; // export. -1 means codec default.
+	int get_sequence_compression() { return sequence_compression; };
+	void set_sequence_compression(int v) { sequence_compression = v; };
+
+	int sequence_padding = 5; // export. Used when file_name has no pattern.
+	int get_sequence_padding() { return sequence_padding; };
+	void set_sequence_padding(int v) { sequence_padding = v; };
+
+	// Chrome trace of the per-frame pipeline stages, written on stop.
+	// Tracing is off while trace_file is empty.
+	godot::String trace_file = ""; // export
+	godot::String get_trace_file() { return trace_file; };
+	void set_trace_file(godot::String v) { trace_file = v; };
+
+	int trace_buffer_size = 65536; // export. Events per thread.
+	int get_trace_buffer_size() { return trace_buffer_size; };
+	void set_trace_buffer_size(int v) { trace_buffer_size = v; };
+
+	Tracer trace;
+
+	// Motion blur: average this many captures into every encoded frame.
+	// Video output only.
+	int subframes = 1; // export
+	int get_subframes() { return subframes; };
+	void set_subframes(int v);
+
+	int active_subframes = 1; // Clamped copy of subframes used while recording.
+	bool subframes_locked = false;
+	int subframe_index = 0;
+	std::vector<uint16_t> subframe_accum;
+
+	// Memory output: mux into a streamable container and keep the bytes for
+	// read_output_chunk() instead of writing to file_name.
+	bool stream_output = false; // export
+	bool get_stream_output() { return stream_output; };
+	void set_stream_output(bool v) { stream_output = v; };
+
+	godot::String stream_format = "mpegts"; // export. e.g. mpegts, webm, mp4.
+	godot::String get_stream_format() { return stream_format; };
+	void set_stream_format(godot::String v) { stream_format = v; };
+
+	int stream_buffer_size = 8 * 1024 * 1024; // export. Bytes held for reading.
+	int get_stream_buffer_size() { return stream_buffer_size; };
+	void set_stream_buffer_size(int v) { stream_buffer_size = v; };
+
+	std::deque<std::vector<uint8_t> > output_chunks;
+	int64_t output_bytes = 0;
+	int64_t output_dropped = 0;
+	godot::Mutex *output_access;
+
 
 #ifdef MULTITHREADED
 	godot::Array frame_buffer;
@@ -144,6 +255,50 @@ class ScreenRecorder : public godot::Node {
 
 	int max_buffer_size = 60;
 
+	// The ring always starts on a keyframe; whole GOPs are evicted at once.
+	std::deque<AVPacket *> replay_ring;
+	int64_t replay_ring_bytes = 0;
+	int64_t replay_max_pts = AV_NOPTS_VALUE;
+	godot::Mutex *replay_access;
+
+	// State handed over to the replay saving thread.
+	godot::Ref<godot::Thread> replay_thread;
+	std::atomic<bool> replay_saving { false };
+	std::vector<AVPacket *> replay_snapshot;
+	AVCodecParameters *replay_par = nullptr;
+	AVDictionary *replay_opt = nullptr;
+	AVRational replay_time_base;
+	godot::String replay_file_name;
+
+	// Engine settings overridden during an offline render.
+	int64_t offline_frames = 0;
+	bool offline_active = false;
+	bool offline_delta_warned = false;
+	bool saved_vsync = true;
+	int64_t saved_target_fps = 0;
+	int64_t saved_iterations_per_second = 60;
+	double saved_physics_jitter_fix = 0.5;
+
+	// A job with a null frame tells a worker to exit.
+	struct SequenceJob {
+		int64_t index;
+		AVFrame *frame;
+	};
+
+	std::queue<SequenceJob> sequence_jobs;
+	std::map<int64_t, std::string> sequence_done; // Empty name means failed.
+	int64_t sequence_next_manifest = 0;
+	int sequence_worker_count = 1;
+	std::string sequence_pattern;
+	godot::String sequence_manifest_name;
+	AVCodec *sequence_codec = nullptr; // nullptr means EXR through godot::Image.
+	AVIOContext *sequence_manifest = nullptr;
+	std::vector<godot::Ref<godot::Thread> > sequence_workers;
+	godot::Mutex *sequence_access;
+	godot::Semaphore *sequence_free_sem;
+	godot::Semaphore *sequence_job_sem;
+	std::atomic<int> sequence_errors { 0 };
+
 
 	AVDictionary *opt        = nullptr;
 	AVCodec *codec           = nullptr;
@@ -164,6 +319,24 @@ class ScreenRecorder : public godot::Node {
 	int write_video_frame();
 	int get_video_frame();
 	void prepare_frame(AVFrame *f);
+	void accumulate_subframe(AVFrame *f);
+	void resolve_subframes(AVFrame *f);
+	void push_replay_packet(AVPacket *pkt);
+	void evict_replay_packets();
+	void clear_replay_ring();
+	void wait_for_replay();
+	void begin_offline_render();
+	void end_offline_render();
+	void finish_offline_render();
+	int initialize_sequence();
+	int start_sequence();
+	int write_sequence_frame();
+	void finish_sequence_frame(int64_t index, const std::string &name);
+	void stop_sequence();
+	void finish_trace();
+	int open_output_stream();
+	void close_output_stream();
+	static int write_output_packet(void *opaque, uint8_t *buf, int buf_size);
 
 public:
 	static void _register_methods();
@@ -176,6 +349,15 @@ public:
 	int recorder_step(); // Put in _process
 	bool is_started();
 	int64_t get_received_frame_count();
+	int save_replay(godot::String path);
+	bool is_saving_replay();
+	godot::PoolByteArray read_output_chunk();
+	int64_t get_output_dropped_bytes();
+
+	void _replay_thread_func(godot::Variant v);
+
+	void _process(float delta);
+	void _sequence_worker_func(godot::Variant v);
 
 #ifdef MULTITHREADED
 	void push_frame();
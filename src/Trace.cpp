@@ -0,0 +1,144 @@
+/*
+ * GDNative FFmpeg Screen Recorder
+ *
+ * Copyright (c) 2022 Visphort <ratelimitingradiators@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software. THE SOFTWARE IS PROVIDED
+ * “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#include "Trace.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cinttypes>
+
+// Sessions are numbered globally so that a thread's cached buffer is never
+// mistaken for one belonging to another session or another Tracer.
+static std::atomic<uint32_t> next_session { 1 };
+
+struct ThreadCache {
+	const void *owner = nullptr;
+	uint32_t session = 0;
+	void *buffer = nullptr;
+};
+
+static thread_local ThreadCache cache;
+
+int64_t Tracer::now_us() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::start(size_t events_per_thread) {
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+
+	buffers.clear();
+	capacity = events_per_thread;
+	session = next_session.fetch_add(1);
+	enabled.store(true, std::memory_order_release);
+}
+
+void Tracer::stop() {
+	enabled.store(false, std::memory_order_release);
+}
+
+Tracer::Buffer *Tracer::get_buffer() {
+	if (cache.owner == this && cache.session == session) {
+		return (Buffer *) cache.buffer;
+	}
+
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+
+	Buffer *b = new Buffer();
+	b->tid = int(buffers.size()) + 1;
+	b->events.resize(capacity);
+	buffers.push_back(std::unique_ptr<Buffer>(b));
+
+	cache.owner = this;
+	cache.session = session;
+	cache.buffer = b;
+
+	return b;
+}
+
+void Tracer::add(const char *name, int64_t frame, int64_t begin_us, int64_t end_us) {
+	// Acquire pairs with start(), so that threads started before it see the
+	// new session and capacity.
+	if (!enabled.load(std::memory_order_acquire))
+		return;
+
+	Buffer *b = get_buffer();
+	size_t n = b->count.load(std::memory_order_relaxed);
+
+	if (n >= b->events.size()) {
+		b->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	b->events[n] = { name, frame, begin_us, end_us };
+	b->count.store(n + 1, std::memory_order_release);
+}
+
+int Tracer::write_json(const char *path) {
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+
+	FILE *f = fopen(path, "w");
+
+	if (!f)
+		return -1;
+
+	int64_t origin = INT64_MAX;
+
+	for (auto &b : buffers) {
+		size_t n = b->count.load(std::memory_order_acquire);
+		if (n > 0 && b->events[0].begin_us < origin)
+			origin = b->events[0].begin_us;
+	}
+
+	if (origin == INT64_MAX)
+		origin = 0;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	bool first = true;
+
+	for (auto &b : buffers) {
+		size_t n = b->count.load(std::memory_order_acquire);
+
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+				first ? "" : ",\n", b->tid, b->tid);
+		first = false;
+
+		for (size_t i = 0; i < n; i++) {
+			const Event &e = b->events[i];
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%" PRId64 ",\"dur\":%" PRId64 ",\"args\":{\"frame\":%" PRId64 "}}",
+					e.name, b->tid, e.begin_us - origin, e.end_us - e.begin_us, e.frame);
+		}
+
+		size_t dropped = b->dropped.load(std::memory_order_relaxed);
+
+		if (dropped > 0) {
+			fprintf(f, ",\n{\"name\":\"dropped_events\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":0,\"args\":{\"count\":%zu}}",
+					b->tid, dropped);
+		}
+	}
+
+	fprintf(f, "\n]}\n");
+
+	return fclose(f) == 0 ? 0 : -1;
+}
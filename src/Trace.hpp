@@ -0,0 +1,99 @@
+/*
+ * GDNative FFmpeg Screen Recorder
+ *
+ * Copyright (c) 2022 Visphort <ratelimitingradiators@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software. THE SOFTWARE IS PROVIDED
+ * “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ * LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+/*
+ * Per-frame pipeline tracing.
+ *
+ * Every thread that records an event gets its own fixed size buffer, which
+ * only that thread writes to, so recording takes no lock. Buffers are
+ * registered under a mutex once per thread and session. On dump, everything
+ * is written out as Chrome Trace Event JSON, which Perfetto and
+ * chrome://tracing can load.
+ *
+ * When disabled, a TraceScope costs one relaxed atomic load.
+ */
+
+class Tracer {
+	struct Event {
+		const char *name; // Must be a string literal.
+		int64_t frame;
+		int64_t begin_us;
+		int64_t end_us;
+	};
+
+	struct Buffer {
+		int tid;
+		std::vector<Event> events;
+		std::atomic<size_t> count { 0 };
+		std::atomic<size_t> dropped { 0 };
+	};
+
+	std::atomic<bool> enabled { false };
+	uint32_t session = 0;
+	size_t capacity = 0;
+
+	std::mutex buffers_mutex;
+	std::vector<std::unique_ptr<Buffer> > buffers;
+
+	Buffer *get_buffer();
+
+public:
+	void start(size_t events_per_thread);
+	void stop();
+	int write_json(const char *path);
+
+	bool is_enabled() const { return enabled.load(std::memory_order_relaxed); }
+	void add(const char *name, int64_t frame, int64_t begin_us, int64_t end_us);
+
+	static int64_t now_us();
+};
+
+class TraceScope {
+	Tracer &tracer;
+	const char *name;
+	int64_t frame;
+	int64_t begin_us = 0;
+	bool active;
+
+public:
+	TraceScope(Tracer &t, const char *n, int64_t f) : tracer(t), name(n), frame(f), active(t.is_enabled()) {
+		if (active)
+			begin_us = Tracer::now_us();
+	}
+
+	~TraceScope() {
+		if (active)
+			tracer.add(name, frame, begin_us, Tracer::now_us());
+	}
+};
+
+#endif // TRACE_H